@@ -3,6 +3,9 @@
 #include <string>
 #include <regex>
 #include <utility>
+#include <set>
+#include <cfloat>
+#include <cmath>
 
 #include "G4RunManager.hh"
 #include "G4Run.hh"
@@ -15,11 +18,14 @@
 #include "G4PhysListFactory.hh"
 #include "G4VisExecutive.hh"
 #include "G4UserSteppingAction.hh"
+#include "G4UserRunAction.hh"
+#include "G4UserEventAction.hh"
 #include "G4Track.hh"
 #include "G4EventManager.hh"
 #include "G4UIdirectory.hh"
 #include "G4UIcmdWithAString.hh"
 #include "G4UIcmdWithABool.hh"
+#include "G4UIcmdWithADoubleAndUnit.hh"
 #include "G4GDMLParser.hh"
 #include "G4TouchableHandle.hh"
 #include "G4PhysicalVolumeStore.hh"
@@ -27,6 +33,14 @@
 #include "G4tgrMessenger.hh"
 #include "G4UserLimits.hh"
 #include "G4UnitsTable.hh"
+#include "G4VSensitiveDetector.hh"
+#include "G4SDManager.hh"
+#include "G4LogicalVolume.hh"
+#include "G4VModularPhysicsList.hh"
+#include "G4GeometrySampler.hh"
+#include "G4ImportanceBiasing.hh"
+#include "G4IStore.hh"
+#include "G4GeometryCell.hh"
 
 #include "g4root.hh"
 #include "g4xml.hh"
@@ -39,6 +53,39 @@ using namespace std;
 using namespace CLHEP;
 
 
+class G4SimpleSteppingAction;
+
+class G4SimpleSensitiveDetector : public G4VSensitiveDetector
+{
+  public:
+    G4SimpleSensitiveDetector(G4SimpleSteppingAction* steppingAction) :
+      G4VSensitiveDetector("g4simpleSD"), fSteppingAction(steppingAction) {}
+    G4bool ProcessHits(G4Step* step, G4TouchableHistory*);
+  private:
+    G4SimpleSteppingAction* fSteppingAction;
+};
+
+
+class G4SimpleRunAction : public G4UserRunAction
+{
+  public:
+    G4SimpleRunAction(G4SimpleSteppingAction* steppingAction) : fSteppingAction(steppingAction) {}
+    void BeginOfRunAction(const G4Run*);
+  private:
+    G4SimpleSteppingAction* fSteppingAction;
+};
+
+
+class G4SimpleEventAction : public G4UserEventAction
+{
+  public:
+    G4SimpleEventAction(G4SimpleSteppingAction* steppingAction) : fSteppingAction(steppingAction) {}
+    void EndOfEventAction(const G4Event*);
+  private:
+    G4SimpleSteppingAction* fSteppingAction;
+};
+
+
 class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
 {
   protected:
@@ -48,12 +95,20 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
     G4UIcmdWithABool* fRecordAllStepsCmd;
     G4UIcmdWithAString* fSilenceOutputCmd;
     G4UIcmdWithAString* fAddOutputCmd;
+    G4UIcmdWithABool* fUseSensDetCmd;
+    G4UIcmdWithADoubleAndUnit* fClusterDistanceCmd;
+    G4UIcmdWithADoubleAndUnit* fClusterTimeCmd;
 
     enum EFormat { kCsv, kXml, kRoot, kHdf5 };
     EFormat fFormat;
     enum EOption { kStepWise, kEventWise };
     EOption fOption;
     bool fRecordAllSteps;
+    G4bool fUseSensDet;
+    G4SimpleSensitiveDetector* fSensDet;
+    G4double fClusterDistance;
+    G4double fClusterTime;
+    G4bool fRowPending;
 
     vector< pair<regex,string> > fPatternPairs;
  
@@ -77,16 +132,19 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
     vector<G4double> fT;
     vector<G4int> fVolID;
     vector<G4int> fIRep;
+    vector<G4double> fWeight;
 
     map<G4VPhysicalVolume*, int> fVolIDMap;
 
     // bools for setting which fields to write to output
-    G4bool fWEv, fWPid, fWTS, fWKE, fWEDep, fWR, fWLR, fWP, fWT, fWV;
+    G4bool fWEv, fWPid, fWTS, fWKE, fWEDep, fWR, fWLR, fWP, fWT, fWV, fWW;
 
   public:
-    G4SimpleSteppingAction() : fNEvents(0), fEventNumber(0), 
+    G4SimpleSteppingAction() : fUseSensDet(false), fSensDet(NULL),
+      fClusterDistance(0), fClusterTime(DBL_MAX), fRowPending(false),
+      fNEvents(0), fEventNumber(0), 
       fWEv(true), fWPid(true), fWTS(true), fWKE(true), fWEDep(true),
-      fWR(true), fWLR(true), fWP(true), fWT(true), fWV(true) 
+      fWR(true), fWLR(true), fWP(true), fWT(true), fWV(true), fWW(false) 
     {
       ResetVars(); 
 
@@ -125,9 +183,32 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
       fAddOutputCmd = new G4UIcmdWithAString("/g4simple/addOutput", this);
       fAddOutputCmd->SetGuidance("Add output fields");
       candidates = "event pid track_step kinetic_energy energy_deposition ";
-      candidates += "position local_position momentum time volume all";
+      candidates += "position local_position momentum time volume weight all";
       fSilenceOutputCmd->SetCandidates(candidates.c_str());
       fAddOutputCmd->SetCandidates(candidates.c_str());
+
+      fUseSensDetCmd = new G4UIcmdWithABool("/g4simple/useSensitiveDetector", this);
+      fUseSensDetCmd->SetParameterName("useSensitiveDetector", true);
+      fUseSensDetCmd->SetDefaultValue(true);
+      fUseSensDetCmd->SetGuidance("Record steps through a sensitive detector attached to the logical volumes of");
+      fUseSensDetCmd->SetGuidance("physical volumes matching the current setVolID patterns, so that steps in");
+      fUseSensDetCmd->SetGuidance("non-sensitive volumes are skipped at minimal cost. Output is unchanged.");
+      fUseSensDetCmd->SetGuidance("The detector is attached at the start of each run.");
+      fUseSensDetCmd->AvailableForStates(G4State_PreInit, G4State_Idle);
+
+      fClusterDistanceCmd = new G4UIcmdWithADoubleAndUnit("/g4simple/setClusterDistance", this);
+      fClusterDistanceCmd->SetParameterName("distance", false);
+      fClusterDistanceCmd->SetDefaultUnit("mm");
+      fClusterDistanceCmd->SetGuidance("Merge consecutive energy-depositing steps of the same track in the same");
+      fClusterDistanceCmd->SetGuidance("sensitive volume that lie within [distance] of the running cluster into a");
+      fClusterDistanceCmd->SetGuidance("single row with summed Edep and energy-weighted position and time.");
+      fClusterDistanceCmd->SetGuidance("Set to 0 (default) to disable. Example: 50 um");
+
+      fClusterTimeCmd = new G4UIcmdWithADoubleAndUnit("/g4simple/setClusterTime", this);
+      fClusterTimeCmd->SetParameterName("time", false);
+      fClusterTimeCmd->SetDefaultUnit("ns");
+      fClusterTimeCmd->SetGuidance("Only merge steps within [time] of the running cluster (default: no limit).");
+      fClusterTimeCmd->SetGuidance("Has no effect unless setClusterDistance is set.");
     }
 
     G4VAnalysisManager* GetAnalysisManager() {
@@ -151,7 +232,7 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
     ~G4SimpleSteppingAction() { 
       G4VAnalysisManager* man = GetAnalysisManager();
       if(man->IsOpenFile()) {
-        if(fOption == kEventWise && fPID.size()>0) WriteRow();
+        WriteEvent();
         man->Write();
         man->CloseFile();
       }
@@ -159,6 +240,9 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
       delete fOutputFormatCmd;
       delete fOutputOptionCmd;
       delete fRecordAllStepsCmd;
+      delete fUseSensDetCmd;
+      delete fClusterDistanceCmd;
+      delete fClusterTimeCmd;
     } 
 
     void SetNewValue(G4UIcommand *command, G4String newValues) {
@@ -197,6 +281,16 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
       if(command == fRecordAllStepsCmd) {
         fRecordAllSteps = fRecordAllStepsCmd->GetNewBoolValue(newValues);
       }
+      if(command == fUseSensDetCmd) {
+        fUseSensDet = fUseSensDetCmd->GetNewBoolValue(newValues);
+        if(!fUseSensDet && fSensDet != NULL) fSensDet->Activate(false);
+      }
+      if(command == fClusterDistanceCmd) {
+        fClusterDistance = fClusterDistanceCmd->GetNewDoubleValue(newValues);
+      }
+      if(command == fClusterTimeCmd) {
+        fClusterTime = fClusterTimeCmd->GetNewDoubleValue(newValues);
+      }
       if(command == fSilenceOutputCmd) {
         G4bool all = (newValues == "all");
         if(all || newValues == "event") fWEv = false;
@@ -209,6 +303,7 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
         if(all || newValues == "momentum") fWP = false;
         if(all || newValues == "time") fWT = false;
         if(all || newValues == "volume") fWV = false;
+        if(all || newValues == "weight") fWW = false;
       }
       if(command == fAddOutputCmd) {
         G4bool all = (newValues == "all");
@@ -222,6 +317,7 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
         if(all || newValues == "momentum") fWP = true;
         if(all || newValues == "time") fWT = true;
         if(all || newValues == "volume") fWV = true;
+        if(all || newValues == "weight") fWW = true;
       }
     }
 
@@ -244,6 +340,48 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
       fT.clear();
       fVolID.clear();
       fIRep.clear();
+      fWeight.clear();
+      fRowPending = false;
+    }
+
+    void AttachSensitiveDetector() {
+      // Called at the start of each run, when the geometry and all setVolID
+      // patterns are known
+      if(!fUseSensDet) return;
+      if(fSensDet == NULL) {
+        // the SD manager takes ownership
+        fSensDet = new G4SimpleSensitiveDetector(this);
+        G4SDManager::GetSDMpointer()->AddNewDetector(fSensDet);
+      }
+      size_t nAttached = 0;
+      G4PhysicalVolumeStore* volumeStore = G4PhysicalVolumeStore::GetInstance();
+      for(auto* vol : *volumeStore) {
+        string name = vol->GetName();
+        for(auto& pp : fPatternPairs) {
+          if(regex_match(name, pp.first)) {
+            vol->GetLogicalVolume()->SetSensitiveDetector(fSensDet);
+            cout << "Attached sensitive detector to volume " << name << endl;
+            nAttached++;
+            break;
+          }
+        }
+      }
+      if(nAttached == 0) {
+        cout << "Warning: useSensitiveDetector: no volume matches a setVolID pattern. "
+             << "Recording through the stepping action instead." << endl;
+      }
+      fSensDet->Activate(nAttached > 0);
+    }
+
+    G4bool UseSensitiveDetector() {
+      return fSensDet != NULL && fSensDet->isActive() && !fRecordAllSteps;
+    }
+
+    // True if the step was already recorded by the sensitive detector
+    G4bool RecordedBySensDet(const G4Step* step) {
+      return step->GetPreStepPoint()->GetSensitiveDetector() == fSensDet &&
+             step->GetTotalEnergyDeposit() > 0 &&
+             GetVolID(step->GetPreStepPoint()) != 0;
     }
 
     G4int GetVolID(G4StepPoint* stepPoint) {
@@ -301,17 +439,99 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
       fPdZ.push_back(momDir.z());
       fT.push_back(stepPoint->GetGlobalTime());
       fIRep.push_back(vol->GetReplicaNumber());
+      // weight the track carried along the step: at a boundary the importance
+      // process may already have split or rouletted the post-step point
+      fWeight.push_back(step->GetPreStepPoint()->GetWeight());
+
+      if(fOption == kStepWise) {
+        // when clustering, a row is final only once the next one is pushed
+        // or the event ends
+        if(fClusterDistance <= 0) WriteRow();
+        else {
+          if(fRowPending) WriteRow(fPID.size()-2);
+          fRowPending = true;
+        }
+      }
+    }
 
-      if(fOption == kStepWise) WriteRow();
+    G4bool MergeIntoCluster(const G4Step* step) {
+      // Merge an energy-depositing post-step point into the last row if it
+      // comes from the same track and volume and lies within the cluster
+      // distance and time of it. The row keeps the summed Edep, the
+      // energy-weighted position and time, and the latest step's KE, momentum
+      // and step number.
+      if(fPID.empty() || fEDep.back() <= 0) return false;
+      G4Track* track = step->GetTrack();
+      if(fTrackID.back() != track->GetTrackID()) return false;
+      G4StepPoint* preStepPoint = step->GetPreStepPoint();
+      G4StepPoint* postStepPoint = step->GetPostStepPoint();
+      if(fVolID.back() != GetVolID(preStepPoint)) return false;
+      // A step leaving the volume ends the cluster: its post-step touchable,
+      // and hence iRep and the local frame, belong to the next volume
+      if(postStepPoint->GetStepStatus() == fGeomBoundary) return false;
+      // Steps deposited with a different weight cannot share a row
+      if(fWeight.back() != preStepPoint->GetWeight()) return false;
+      G4TouchableHandle vol = postStepPoint->GetTouchableHandle();
+      if(fIRep.back() != vol->GetReplicaNumber()) return false;
+      G4ThreeVector pos = postStepPoint->GetPosition();
+      G4ThreeVector clusterPos(fX.back(), fY.back(), fZ.back());
+      if((pos - clusterPos).mag() > fClusterDistance) return false;
+      G4double t = postStepPoint->GetGlobalTime();
+      if(fabs(t - fT.back()) > fClusterTime) return false;
+
+      G4double eDep = step->GetTotalEnergyDeposit();
+      G4double eSum = fEDep.back() + eDep;
+      G4double w = eDep/eSum;
+      G4ThreeVector lPos = vol->GetHistory()->GetTopTransform().TransformPoint(pos);
+      fX.back() += w*(pos.x() - fX.back());
+      fY.back() += w*(pos.y() - fY.back());
+      fZ.back() += w*(pos.z() - fZ.back());
+      fLX.back() += w*(lPos.x() - fLX.back());
+      fLY.back() += w*(lPos.y() - fLY.back());
+      fLZ.back() += w*(lPos.z() - fLZ.back());
+      fT.back() += w*(t - fT.back());
+      fEDep.back() = eSum;
+      fKE.back() = postStepPoint->GetKineticEnergy();
+      G4ThreeVector momDir = postStepPoint->GetMomentumDirection();
+      fPdX.back() = momDir.x();
+      fPdY.back() = momDir.y();
+      fPdZ.back() = momDir.z();
+      fStepNumber.back() = track->GetCurrentStepNumber();
+      return true;
+    }
+
+    void PushDeposit(const G4Step* step) {
+      // Push the post-step data of an energy-depositing step in a sensitive
+      // volume, clustering it with the previous one if requested
+      if(fClusterDistance > 0 && MergeIntoCluster(step)) return;
+      PushData(step);
+    }
+
+    void EndOfEvent() {
+      // write out the event while fEventNumber still refers to it
+      WriteEvent();
+      ResetVars();
+    }
+
+    void FlushPendingRow() {
+      if(!fRowPending) return;
+      WriteRow(fPID.size()-1);
+      fRowPending = false;
     }
 
-    void WriteRow() {
+    void WriteEvent() {
+      if(fOption == kEventWise && fPID.size()>0) WriteRow();
+      else FlushPendingRow();
+    }
+
+    void WriteRow() { WriteRow(fPID.size()-1); }
+
+    void WriteRow(size_t i) {
       G4VAnalysisManager* man = GetAnalysisManager();
       int iCol = 0;
       if(fWEv) man->FillNtupleIColumn(iCol++, fNEvents);
       if(fWEv) man->FillNtupleIColumn(iCol++, fEventNumber);
       if(fOption == kStepWise) {
-        size_t i = fPID.size()-1;
         if(fWPid) man->FillNtupleIColumn(iCol++, fPID[i]);
         if(fWTS) man->FillNtupleIColumn(iCol++, fTrackID[i]);
         if(fWTS) man->FillNtupleIColumn(iCol++, fParentID[i]);
@@ -330,15 +550,14 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
         if(fWT) man->FillNtupleDColumn(iCol++, fT[i]);
         if(fWV) man->FillNtupleIColumn(iCol++, fVolID[i]);
         if(fWV) man->FillNtupleIColumn(iCol++, fIRep[i]);
+        if(fWW) man->FillNtupleDColumn(iCol++, fWeight[i]);
       }
       // for event-wise, manager copies data from vectors over
       // automatically in the next line
       man->AddNtupleRow();
     }
 
-    void UserSteppingAction(const G4Step *step) {
-      // This is the main function where we decide what to pull out and write
-      // to an output file
+    void PrepareOutput() {
       G4VAnalysisManager* man = GetAnalysisManager();
 
       // Open up a file if one is not open already
@@ -367,6 +586,7 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
           if(fWT) man->CreateNtupleDColumn("t", fT);
           if(fWV) man->CreateNtupleIColumn("volID", fVolID);
           if(fWV) man->CreateNtupleIColumn("iRep", fIRep);
+          if(fWW) man->CreateNtupleDColumn("weight", fWeight);
         }
         else if(fOption == kStepWise) {
           if(fWPid) man->CreateNtupleIColumn("pid");
@@ -387,6 +607,7 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
           if(fWT) man->CreateNtupleDColumn("t");
           if(fWV) man->CreateNtupleIColumn("volID");
           if(fWV) man->CreateNtupleIColumn("iRep");
+          if(fWW) man->CreateNtupleDColumn("weight");
         }
         else {
           cout << "ERROR: Unknown output option " << fOption << endl;
@@ -404,17 +625,59 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
         fVolIDMap.clear();
       }
 
-      // Get the event number for recording
+      // Get the event number for recording. The previous event was already
+      // written out by EndOfEvent.
       fEventNumber = G4EventManager::GetEventManager()->GetConstCurrentEvent()->GetEventID();
-      static G4int lastEventID = fEventNumber;
-      if(fEventNumber != lastEventID) {
-        if(fOption == kEventWise && fPID.size()>0) WriteRow();
-        ResetVars();
-        lastEventID = fEventNumber;
+    }
+
+    G4bool RecordSensitiveStep(const G4Step* step) {
+      // Called by the sensitive detector for steps whose pre-step point lies
+      // in a volume it is attached to. Mirrors the sensitive-volume branch of
+      // UserSteppingAction below.
+      if(!UseSensitiveDetector()) return false;
+      if(step->GetTotalEnergyDeposit() <= 0) return false;
+      // The logical volume may be shared with non-matching physical volumes
+      if(GetVolID(step->GetPreStepPoint()) == 0) return false;
+      PrepareOutput();
+      // Pre-step data for the first step of the track, including the primary:
+      // the SD is invoked before UserSteppingAction, which skips it for us.
+      if(step->GetTrack()->GetCurrentStepNumber() == 1) {
+        PushData(step, true);
       }
+      PushDeposit(step);
+      return true;
+    }
 
-      // If writing out all steps, just write and return.
+    void UserSteppingAction(const G4Step *step) {
+      // This is the main function where we decide what to pull out and write
+      // to an output file
       G4bool usePreStep = true;
+      G4bool zeroEdep = true;
+
+      // With the sensitive detector, steps in sensitive volumes were already
+      // recorded; only the primary's first step and entries into a sensitive
+      // volume from outside are left to handle here. Test the cheapest
+      // conditions first so that non-sensitive steps return immediately.
+      if(UseSensitiveDetector()) {
+        G4Track* track = step->GetTrack();
+        if(track->GetTrackID() == 1 && track->GetCurrentStepNumber() == 1 &&
+           !RecordedBySensDet(step)) {
+          PrepareOutput();
+          PushData(step, usePreStep);
+        }
+        if(step->GetTotalEnergyDeposit() <= 0) return;
+        G4StepPoint* postStepPoint = step->GetPostStepPoint();
+        if(postStepPoint->GetSensitiveDetector() != fSensDet) return;
+        if(step->GetPreStepPoint()->GetPhysicalVolume() == postStepPoint->GetPhysicalVolume()) return;
+        if(RecordedBySensDet(step) || GetVolID(postStepPoint) == 0) return;
+        PrepareOutput();
+        PushData(step, usePreStep=false, zeroEdep);
+        return;
+      }
+
+      PrepareOutput();
+
+      // If writing out all steps, just write and return.
       if(fRecordAllSteps) {
         if(step->GetTrack()->GetCurrentStepNumber() == 1) {
           PushData(step, usePreStep);
@@ -441,7 +704,7 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
           PushData(step, usePreStep);
         }
         // Record post-step data for all sens vol steps
-        PushData(step);
+        PushDeposit(step);
         return; // don't need to re-write poststep below if we already wrote it out
       }
 
@@ -450,7 +713,6 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
       // vol pointer changes.
       // Have to do this last because we might have already written it out
       // during the last step of the previous volume if it was also sensitive.
-      G4bool zeroEdep = true;
       if(step->GetPreStepPoint()->GetPhysicalVolume() != step->GetPostStepPoint()->GetPhysicalVolume()) {
         if(postID != 0 && step->GetTotalEnergyDeposit() > 0) {
           PushData(step, usePreStep=false, zeroEdep);
@@ -461,6 +723,24 @@ class G4SimpleSteppingAction : public G4UserSteppingAction, public G4UImessenger
 };
 
 
+G4bool G4SimpleSensitiveDetector::ProcessHits(G4Step* step, G4TouchableHistory*)
+{
+  return fSteppingAction->RecordSensitiveStep(step);
+}
+
+
+void G4SimpleRunAction::BeginOfRunAction(const G4Run*)
+{
+  fSteppingAction->AttachSensitiveDetector();
+}
+
+
+void G4SimpleEventAction::EndOfEventAction(const G4Event*)
+{
+  fSteppingAction->EndOfEvent();
+}
+
+
 class G4SimplePrimaryGeneratorAction : public G4VUserPrimaryGeneratorAction
 {
   public:
@@ -490,9 +770,15 @@ class G4SimpleRunManager : public G4RunManager, public G4UImessenger
     G4UIcmdWithABool* fRandomSeedCmd;
     G4UIcmdWithAString* fListVolsCmd;
     G4UIcommand* fSetStepLimitCmd;
+    G4UIcmdWithAString* fImportanceSamplingCmd;
+    G4UIcommand* fSetImportanceCmd;
+
+    G4VModularPhysicsList* fPhysList;
+    G4VPhysicalVolume* fWorld;
+    vector<G4GeometrySampler*> fSamplers;
 
   public:
-    G4SimpleRunManager() {
+    G4SimpleRunManager() : fPhysList(NULL), fWorld(NULL) {
       fDirectory = new G4UIdirectory("/g4simple/");
       fDirectory->SetGuidance("Parameters for g4simple MC");
 
@@ -526,6 +812,22 @@ class G4SimpleRunManager : public G4RunManager, public G4UImessenger
       fSetStepLimitCmd->SetParameter(new G4UIparameter("stepLimitWithUnit", 's', false));
       fSetStepLimitCmd->SetParameter(new G4UIparameter("volNameRegex", 's', true));
       fSetStepLimitCmd->SetGuidance("Set maximum allowed step length with unit for volumes matching the provided regex (or all volumes if none is provided). Example: 1.0 um");
+
+      fImportanceSamplingCmd = new G4UIcmdWithAString("/g4simple/useImportanceSampling", this);
+      fImportanceSamplingCmd->SetParameterName("particle", false);
+      fImportanceSamplingCmd->SetGuidance("Turn on geometry importance sampling (splitting and Russian roulette) for the given particle");
+      fImportanceSamplingCmd->SetGuidance("Repeat for each particle to be biased. Must come after the physics list and geometry, and before /run/initialize");
+      fImportanceSamplingCmd->SetGuidance("Also adds the track weight to the output (see /g4simple/addOutput weight)");
+      fImportanceSamplingCmd->AvailableForStates(G4State_PreInit);
+
+      fSetImportanceCmd = new G4UIcommand("/g4simple/setImportance", this);
+      G4UIparameter* importancePar = new G4UIparameter("importance", 'd', false);
+      importancePar->SetParameterRange("importance>=0");
+      fSetImportanceCmd->SetParameter(importancePar);
+      fSetImportanceCmd->SetParameter(new G4UIparameter("volNameRegex", 's', true));
+      fSetImportanceCmd->SetGuidance("Set the importance of physical volumes matching the provided regex (or all volumes if none is provided)");
+      fSetImportanceCmd->SetGuidance("Volumes not set keep importance 1. Requires /g4simple/useImportanceSampling; must come after /run/initialize");
+      fSetImportanceCmd->AvailableForStates(G4State_Idle);
     }
 
     ~G4SimpleRunManager() {
@@ -535,13 +837,30 @@ class G4SimpleRunManager : public G4RunManager, public G4UImessenger
       delete fTGDetectorCmd;
       delete fRandomSeedCmd;
       delete fListVolsCmd;
+      delete fImportanceSamplingCmd;
+      delete fSetImportanceCmd;
+      for (auto* sampler : fSamplers) delete sampler;
+    }
+
+    void Initialize() {
+      G4RunManager::Initialize();
+      // Every cell the sampler may see needs an importance: once the world
+      // is known to the importance store, give all of them a default of 1
+      if (!fSamplers.empty()) {
+        set<G4LogicalVolume*> visited;
+        AddDefaultImportances(fWorld, visited);
+      }
     }
 
     void SetNewValue(G4UIcommand *command, G4String newValues) {
       if(command == fPhysListCmd) {
-        SetUserInitialization((new G4PhysListFactory)->GetReferencePhysList(newValues));
+        fPhysList = (new G4PhysListFactory)->GetReferencePhysList(newValues);
+        SetUserInitialization(fPhysList);
         SetUserAction(new G4SimplePrimaryGeneratorAction); // must come after phys list
-        SetUserAction(new G4SimpleSteppingAction); // must come after phys list
+        G4SimpleSteppingAction* steppingAction = new G4SimpleSteppingAction;
+        SetUserAction(steppingAction); // must come after phys list
+        SetUserAction(new G4SimpleRunAction(steppingAction));
+        SetUserAction(new G4SimpleEventAction(steppingAction));
       }
       else if(command == fDetectorCmd) {
         istringstream iss(newValues);
@@ -550,13 +869,15 @@ class G4SimpleRunManager : public G4RunManager, public G4UImessenger
         iss >> filename >> validate;
         G4GDMLParser parser;
         parser.Read(filename, validate == "1" || validate == "true" || validate == "True");
-        SetUserInitialization(new G4SimpleDetectorConstruction(parser.GetWorldVolume()));
+        fWorld = parser.GetWorldVolume();
+        SetUserInitialization(new G4SimpleDetectorConstruction(fWorld));
       }
       else if(command == fTGDetectorCmd) {
         new G4tgrMessenger;
         G4tgbVolumeMgr* volmgr = G4tgbVolumeMgr::GetInstance();
         volmgr->AddTextFile(newValues);
-        SetUserInitialization(new G4SimpleDetectorConstruction(volmgr->ReadAndConstructDetector()));
+        fWorld = volmgr->ReadAndConstructDetector();
+        SetUserInitialization(new G4SimpleDetectorConstruction(fWorld));
       }
       else if(command == fRandomSeedCmd) {
         bool useURandom = fRandomSeedCmd->GetNewBoolValue(newValues);
@@ -606,6 +927,32 @@ class G4SimpleRunManager : public G4RunManager, public G4UImessenger
         // Call ApplyStepLimit with the parsed and converted step limit
         ApplyStepLimit(g4_step_max, volNameRegex);
       }
+
+      else if (command == fImportanceSamplingCmd) {
+        if (fPhysList == NULL || fWorld == NULL) {
+          cout << "useImportanceSampling: set the physics list and geometry first. Importance sampling not enabled." << endl;
+          return;
+        }
+        G4GeometrySampler* sampler = new G4GeometrySampler(fWorld, newValues);
+        sampler->SetParallel(false);
+        fPhysList->RegisterPhysics(new G4ImportanceBiasing(sampler));
+        fSamplers.push_back(sampler);
+        G4UImanager::GetUIpointer()->ApplyCommand("/g4simple/addOutput weight");
+      }
+
+      else if (command == fSetImportanceCmd) {
+        if (fSamplers.empty()) {
+          cout << "setImportance: importance sampling is not enabled, see /g4simple/useImportanceSampling" << endl;
+          return;
+        }
+        istringstream iss(newValues);
+        G4double importance;
+        G4String volNameRegex;
+        iss >> importance;
+        std::getline(iss >> std::ws, volNameRegex);
+        if (volNameRegex == "") volNameRegex = ".*";
+        ApplyImportance(importance, volNameRegex);
+      }
     }
 
     void ApplyStepLimit(G4double g4_step_max, const G4String& volNameRegex) {
@@ -622,6 +969,46 @@ class G4SimpleRunManager : public G4RunManager, public G4UImessenger
         }
       }
     }
+
+    void AddDefaultImportances(G4VPhysicalVolume* vol, set<G4LogicalVolume*>& visited) {
+      // Walk the tree under vol. Replicated and parameterised volumes get one
+      // cell per copy so that tracking through them does not abort.
+      G4IStore* istore = G4IStore::GetInstance();
+      G4int nCopies = vol->IsReplicated() ? vol->GetMultiplicity() : 1;
+      for (G4int i = 0; i < nCopies; i++) {
+        G4int copyNo = vol->IsReplicated() ? i : vol->GetCopyNo();
+        if (!istore->IsKnown(G4GeometryCell(*vol, copyNo))) {
+          istore->AddImportanceGeometryCell(1, *vol, copyNo);
+        }
+      }
+      G4LogicalVolume* logicalVolume = vol->GetLogicalVolume();
+      if (!visited.insert(logicalVolume).second) return;
+      for (size_t i = 0; i < logicalVolume->GetNoDaughters(); i++) {
+        AddDefaultImportances(logicalVolume->GetDaughter(i), visited);
+      }
+    }
+
+    void ApplyImportance(G4double importance, const G4String& volNameRegex) {
+      G4IStore* istore = G4IStore::GetInstance();
+      G4PhysicalVolumeStore* volumeStore = G4PhysicalVolumeStore::GetInstance();
+      std::regex pattern(volNameRegex);
+      for (auto* vol : *volumeStore) {
+        if (std::regex_match(vol->GetName(), pattern)) {
+          if (!istore->IsKnown(G4GeometryCell(*vol, vol->IsReplicated() ? 0 : vol->GetCopyNo()))) {
+            G4cout << "setImportance: " << vol->GetName() << " is not part of the world volume. Skipped." << G4endl;
+            continue;
+          }
+          // replicated and parameterised volumes have one cell per copy
+          if (vol->IsReplicated()) {
+            for (G4int i = 0; i < vol->GetMultiplicity(); i++) {
+              istore->ChangeImportance(importance, *vol, i);
+            }
+          }
+          else istore->ChangeImportance(importance, *vol, vol->GetCopyNo());
+          G4cout << "Set importance of " << importance << " for volume " << vol->GetName() << G4endl;
+        }
+      }
+    }
 };
 
 